@@ -22,15 +22,16 @@ public:
             file_ << "user_id,track_id,action,ms_listened,ms_track,timestamp\n";
         }
     }
-    void log(const Feedback& fb) {
+    void log(const Feedback& fb, bool flush_now = true) {
         file_ << fb.user_id << ','
               << fb.track_id << ','
               << to_cstr(fb.action) << ','
               << fb.ms_listened << ','
               << fb.ms_track << ','
               << fb.ts_ms << "\n";
-        file_.flush();
+        if (flush_now) file_.flush();
     }
+    void flush() { file_.flush(); }
     static long long now_ms() {
         using namespace std::chrono;
         return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
@@ -1,10 +1,18 @@
 #pragma once
+#include <algorithm>
+#include <chrono>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include "SongRegistry.hpp"
 #include "SongSplay.hpp"
 #include "Logger.hpp"
 #include "ActionPolicy.hpp"
 #include "ml_similarity.hpp"
+#include "PrefetchQueue.hpp"
 
 class PlayerController {
     SongRegistry& registry_;
@@ -14,49 +22,186 @@ class PlayerController {
     int log_counter_ = 0;
     int retrain_every_ = 20; // retrain after N logs
 
+    // Prefetch: tree_mu_ guards profile_/tree_/song scores, which the worker reads
+    std::mutex tree_mu_;
+    std::mutex sessions_mu_;
+    struct Session {
+        std::shared_ptr<PrefetchQueue> q; // shared: a running refill may outlive eviction
+        std::chrono::steady_clock::time_point last_used;
+    };
+    std::unordered_map<std::string, Session> sessions_;
+    size_t max_sessions_ = 100000; // oldest 1/8 evicted when a new session would exceed this
+    PrefetchStats evicted_stats_;  // counters of sessions already evicted
+    size_t prefetch_depth_ = 5;
+    PrefetchWorker worker_; // last member: joined before the tree goes away
+
 public:
     explicit PlayerController(SongRegistry& reg)
-        : registry_(reg), profile_(), tree_(&profile_), logger_() {
+        : registry_(reg), profile_(), tree_(&profile_), logger_(),
+          worker_([this](const std::string& sid){ refill(sid); }) {
         ml_engine().init(); // load weights/clusters
     }
 
     void set_retrain_batch(int n) { retrain_every_ = n; }
+    void set_prefetch_depth(size_t n) { prefetch_depth_ = n ? n : 1; }
+    void set_max_sessions(size_t n) { max_sessions_ = n ? n : 1; }
+
+    // Next track for this session: O(1) pop from the ready queue on a hit,
+    // synchronous top-K ranking on a miss. nullptr if the tree is empty.
+    Song* next(const std::string& user_id) {
+        auto qp = session(user_id); PrefetchQueue& q = *qp;
+        Song* s = q.pop();
+        if (!s) {
+            std::vector<Song*> ranked;
+            {
+                std::lock_guard<std::mutex> lk(tree_mu_);
+                ranked = tree_.topK(prefetch_depth_ + q.exclusion_size());
+            }
+            s = q.take_first_fresh(ranked);
+            worker_.schedule(user_id);
+        } else if (q.size() < (prefetch_depth_ + 1) / 2) {
+            worker_.schedule(user_id);
+        }
+        return s;
+    }
+
+    bool has_song(const std::string& track_id) const { return registry_.get(track_id) != nullptr; }
+
+    // Current best K tracks (shared tree, not session-filtered)
+    std::vector<Song*> topK(size_t k) {
+        std::lock_guard<std::mutex> lk(tree_mu_);
+        return tree_.topK(k);
+    }
+
+    PrefetchStats prefetch_stats(const std::string& user_id) {
+        auto qp = find_session(user_id);
+        return qp ? qp->stats() : PrefetchStats{};
+    }
+
+    // Aggregate over all sessions, including evicted ones
+    PrefetchStats prefetch_stats() {
+        std::lock_guard<std::mutex> lk(sessions_mu_);
+        PrefetchStats tot = evicted_stats_;
+        for (auto& kv : sessions_) add_stats(tot, kv.second.q->stats());
+        return tot;
+    }
+
+    size_t session_count() {
+        std::lock_guard<std::mutex> lk(sessions_mu_); return sessions_.size();
+    }
+
+    // Drop sessions not used for `idle`; returns how many were removed
+    size_t evict_idle(std::chrono::milliseconds idle) {
+        auto cutoff = std::chrono::steady_clock::now() - idle;
+        std::lock_guard<std::mutex> lk(sessions_mu_);
+        size_t n = 0;
+        for (auto it = sessions_.begin(); it != sessions_.end();) {
+            if (it->second.last_used < cutoff) {
+                add_stats(evicted_stats_, it->second.q->stats());
+                it = sessions_.erase(it); ++n;
+            } else ++it;
+        }
+        return n;
+    }
 
     // Call when a user acts on a track
     void onAction(const std::string& user_id, const std::string& track_id, Action a,
                   int ms_listened=0) {
-        Song* s = registry_.get(track_id);
-        if (!s) return;
+        onActions({ActionEvent{user_id, track_id, a, ms_listened}});
+    }
+
+    struct ActionEvent {
+        std::string user_id;
+        std::string track_id;
+        Action action;
+        int ms_listened = 0;
+    };
+
+    // Apply several actions in order as one batch: sessions_mu_ and tree_mu_
+    // are taken once, refills are scheduled once per user, the log is flushed
+    // and weights are hot-reloaded once. Unknown tracks are skipped; known[i]
+    // (if given) reports which events were applied. Returns that count.
+    size_t onActions(const std::vector<ActionEvent>& evs, std::vector<char>* known = nullptr) {
+        if (known) known->assign(evs.size(), 0);
+        std::vector<Song*> songs(evs.size(), nullptr);
+        std::vector<std::shared_ptr<PrefetchQueue>> queues(evs.size());
+        size_t applied = 0;
+        {
+            auto now = std::chrono::steady_clock::now();
+            std::lock_guard<std::mutex> lk(sessions_mu_);
+            for (size_t i = 0; i < evs.size(); ++i) {
+                songs[i] = registry_.get(evs[i].track_id);
+                if (!songs[i]) continue;
+                queues[i] = session_locked(evs[i].user_id, now);
+                if (known) (*known)[i] = 1;
+                ++applied;
+            }
+        }
+        if (!applied) return 0;
+
+        for (size_t i = 0; i < evs.size(); ++i) {
+            if (!songs[i]) continue;
+            Action a = evs[i].action;
+            if (a == Action::DISLIKE || a == Action::NOT_INTERESTED) queues[i]->block(songs[i]);
+            else if (a == Action::LIKE || a == Action::REPLAY) queues[i]->unblock(songs[i]);
+            queues[i]->remember(songs[i]);
+        }
 
         // Apply delta policy
-        int d = ActionPolicy::delta(a);
-        if (a == Action::NOT_INTERESTED) {
-            s->user_score = 0;      // reset personal affinity to this song
-            profile_.soft_reset(0.1); // gently re-center profile
-        } else {
-            tree_.promote(s, d);
+        {
+            std::lock_guard<std::mutex> lk(tree_mu_);
+            for (size_t i = 0; i < evs.size(); ++i) {
+                Song* s = songs[i]; if (!s) continue;
+                Action a = evs[i].action;
+                if (a == Action::NOT_INTERESTED) {
+                    s->user_score = 0;      // reset personal affinity to this song
+                    profile_.soft_reset(0.1); // gently re-center profile
+                    tree_.rescore(s);
+                } else {
+                    tree_.promote(s, ActionPolicy::delta(a));
+                }
+                // Strong negative: drop what was queued. Cancelling after the
+                // mutation, under tree_mu_, means any refill that sees the new
+                // generation also ranks the post-action tree.
+                if (a == Action::DISLIKE || a == Action::NOT_INTERESTED) queues[i]->cancel();
+            }
         }
 
+        // Refill in the background, once per user
+        std::unordered_set<std::string> users;
+        for (size_t i = 0; i < evs.size(); ++i)
+            if (songs[i] && users.insert(evs[i].user_id).second) worker_.schedule(evs[i].user_id);
+
         // Log
-        Feedback fb;
-        fb.user_id = user_id; fb.track_id = track_id; fb.action = a;
-        fb.ms_listened = ms_listened; fb.ms_track = s->duration_ms;
-        fb.ts_ms = Logger::now_ms();
-        logger_.log(fb);
+        long long ts = Logger::now_ms();
+        for (size_t i = 0; i < evs.size(); ++i) {
+            if (!songs[i]) continue;
+            Feedback fb;
+            fb.user_id = evs[i].user_id; fb.track_id = evs[i].track_id; fb.action = evs[i].action;
+            fb.ms_listened = evs[i].ms_listened; fb.ms_track = songs[i]->duration_ms;
+            fb.ts_ms = ts;
+            logger_.log(fb, false);
+        }
+        logger_.flush();
 
         // Trigger bulk retrain
-        if (++log_counter_ >= retrain_every_) {
+        log_counter_ += (int)applied;
+        if (log_counter_ >= retrain_every_) {
             retrain_weights();
             log_counter_ = 0;
         }
 
         // Hot-reload weights if changed
         ml_engine().hot_reload();
+        return applied;
     }
 
     // Insert a library track into the splay once (e.g., during boot)
     void ingest_song(const std::string& track_id) {
-        if (auto* s = registry_.get(track_id)) tree_.insert(s);
+        if (auto* s = registry_.get(track_id)) {
+            std::lock_guard<std::mutex> lk(tree_mu_);
+            tree_.insert(s);
+        }
     }
 
     // naive demo: ingest first K songs
@@ -68,6 +213,65 @@ public:
     std::vector<std::string> preload_ids_;
 
 private:
+    static void add_stats(PrefetchStats& tot, const PrefetchStats& st) {
+        tot.hits += st.hits; tot.misses += st.misses;
+        tot.refills += st.refills; tot.rebuilds += st.rebuilds;
+    }
+
+    // Get or create; marks the session as used
+    std::shared_ptr<PrefetchQueue> session(const std::string& user_id) {
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lk(sessions_mu_);
+        return session_locked(user_id, now);
+    }
+
+    std::shared_ptr<PrefetchQueue> session_locked(const std::string& user_id,
+                                                  std::chrono::steady_clock::time_point now) {
+        auto it = sessions_.find(user_id);
+        if (it == sessions_.end()) {
+            if (sessions_.size() >= max_sessions_) evict_oldest_locked(sessions_.size() / 8 + 1);
+            it = sessions_.emplace(user_id, Session{std::make_shared<PrefetchQueue>(), now}).first;
+        }
+        it->second.last_used = now;
+        return it->second.q;
+    }
+
+    std::shared_ptr<PrefetchQueue> find_session(const std::string& user_id) {
+        std::lock_guard<std::mutex> lk(sessions_mu_);
+        auto it = sessions_.find(user_id);
+        return it == sessions_.end() ? nullptr : it->second.q;
+    }
+
+    // LRU eviction in batches, so a flood of new ids costs O(1) amortized
+    void evict_oldest_locked(size_t n) {
+        std::vector<std::pair<std::chrono::steady_clock::time_point, const std::string*>> by_age;
+        by_age.reserve(sessions_.size());
+        for (auto& kv : sessions_) by_age.emplace_back(kv.second.last_used, &kv.first);
+        n = std::min(n, by_age.size());
+        std::nth_element(by_age.begin(), by_age.begin() + (long)n, by_age.end());
+        std::vector<std::string> victims;
+        for (size_t i = 0; i < n; ++i) victims.push_back(*by_age[i].second);
+        for (auto& id : victims) {
+            auto it = sessions_.find(id);
+            add_stats(evicted_stats_, it->second.q->stats());
+            sessions_.erase(it);
+        }
+    }
+
+    // Runs on the prefetch worker; a session evicted meanwhile is not recreated
+    void refill(const std::string& user_id) {
+        auto qp = find_session(user_id);
+        if (!qp) return;
+        PrefetchQueue& q = *qp;
+        uint64_t gen = q.generation();
+        std::vector<Song*> ranked;
+        {
+            std::lock_guard<std::mutex> lk(tree_mu_);
+            ranked = tree_.topK(prefetch_depth_ + q.exclusion_size());
+        }
+        q.fill(ranked, prefetch_depth_, gen); // dropped if cancelled meanwhile
+    }
+
     void retrain_weights() {
         // Call python script. Adjust paths to match your repo layout.
         // It will regenerate data/feature_weights.json
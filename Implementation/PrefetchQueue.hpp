@@ -0,0 +1,176 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "Song.hpp"
+
+struct PrefetchStats {
+    uint64_t hits = 0;     // next() served from the ready queue
+    uint64_t misses = 0;   // next() had to rank synchronously
+    uint64_t refills = 0;  // worker results installed
+    uint64_t rebuilds = 0; // queues cancelled by a strong negative signal
+
+    double hit_rate() const {
+        uint64_t n = hits + misses; return n ? (double)hits / (double)n : 0.0;
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& os, const PrefetchStats& st) {
+    return os << "prefetch hits=" << st.hits << " misses=" << st.misses
+              << " hit_rate=" << st.hit_rate() << " refills=" << st.refills
+              << " rebuilds=" << st.rebuilds;
+}
+
+// Small ready queue of next-N tracks for one session.
+// The worker fills it, the player pops from it in O(1).
+class PrefetchQueue {
+    std::mutex mu_;
+    std::deque<Song*> ready_;
+    std::deque<const Song*> recent_; // served/acted tracks kept out of refills
+    size_t recent_cap_ = 32;
+    std::unordered_set<const Song*> blocked_; // DISLIKE / NOT_INTERESTED, until liked again
+    uint64_t gen_ = 0; // bumped on cancel; stale refills are dropped
+    std::atomic<uint64_t> hits_{0}, misses_{0}, refills_{0}, rebuilds_{0};
+public:
+    // Pop the next track; returns nullptr (and counts a miss) when empty
+    Song* pop() {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (ready_.empty()) { ++misses_; return nullptr; }
+        Song* s = ready_.front(); ready_.pop_front();
+        remember_locked(s);
+        ++hits_;
+        return s;
+    }
+
+    // Keep a track out of the next refills (acted on, or served on a miss)
+    void remember(const Song* s) {
+        std::lock_guard<std::mutex> lk(mu_); remember_locked(s);
+    }
+
+    // Strong negative: never serve this track again in this session
+    void block(const Song* s) {
+        std::lock_guard<std::mutex> lk(mu_); blocked_.insert(s);
+    }
+
+    void unblock(const Song* s) {
+        std::lock_guard<std::mutex> lk(mu_); blocked_.erase(s);
+    }
+
+    // Miss path: first ranked track not recent or blocked, remembered as served
+    Song* take_first_fresh(const std::vector<Song*>& ranked) {
+        std::lock_guard<std::mutex> lk(mu_);
+        for (Song* s : ranked) {
+            if (is_excluded_locked(s)) continue;
+            remember_locked(s);
+            return s;
+        }
+        return nullptr;
+    }
+
+    uint64_t generation() {
+        std::lock_guard<std::mutex> lk(mu_); return gen_;
+    }
+
+    // Install a freshly ranked list, unless it was cancelled meanwhile.
+    // Recent and blocked tracks are skipped; at most `depth` are kept.
+    bool fill(const std::vector<Song*>& ranked, size_t depth, uint64_t gen) {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (gen != gen_) return false;
+        ready_.clear();
+        for (Song* s : ranked) {
+            if (ready_.size() >= depth) break;
+            if (is_excluded_locked(s)) continue;
+            ready_.push_back(s);
+        }
+        ++refills_;
+        return true;
+    }
+
+    // Drop everything queued and invalidate in-flight refills
+    void cancel() {
+        std::lock_guard<std::mutex> lk(mu_);
+        ready_.clear(); ++gen_; ++rebuilds_;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lk(mu_); return ready_.size();
+    }
+
+    // How many ranked candidates a refill may have to skip
+    size_t exclusion_size() {
+        std::lock_guard<std::mutex> lk(mu_); return recent_cap_ + blocked_.size();
+    }
+
+    PrefetchStats stats() const {
+        PrefetchStats st;
+        st.hits = hits_; st.misses = misses_; st.refills = refills_; st.rebuilds = rebuilds_;
+        return st;
+    }
+
+private:
+    bool is_excluded_locked(const Song* s) const {
+        return blocked_.count(s) || std::find(recent_.begin(), recent_.end(), s) != recent_.end();
+    }
+
+    void remember_locked(const Song* s) {
+        if (!s) return;
+        recent_.push_back(s);
+        if (recent_.size() > recent_cap_) recent_.pop_front();
+    }
+};
+
+// Single background thread that runs refill jobs keyed by session id.
+// Repeated requests for the same session collapse into one pending job.
+class PrefetchWorker {
+    std::function<void(const std::string&)> job_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<std::string> pending_;
+    std::unordered_set<std::string> queued_;
+    bool stop_ = false;
+    std::thread th_;
+
+    void run() {
+        for (;;) {
+            std::string sid;
+            {
+                std::unique_lock<std::mutex> lk(mu_);
+                cv_.wait(lk, [&]{ return stop_ || !pending_.empty(); });
+                if (stop_) return;
+                sid = std::move(pending_.front()); pending_.pop_front();
+                queued_.erase(sid);
+            }
+            job_(sid);
+        }
+    }
+public:
+    explicit PrefetchWorker(std::function<void(const std::string&)> job)
+        : job_(std::move(job)), th_([this]{ run(); }) {}
+
+    ~PrefetchWorker() {
+        { std::lock_guard<std::mutex> lk(mu_); stop_ = true; }
+        cv_.notify_all();
+        if (th_.joinable()) th_.join();
+    }
+
+    PrefetchWorker(const PrefetchWorker&) = delete;
+    PrefetchWorker& operator=(const PrefetchWorker&) = delete;
+
+    void schedule(const std::string& sid) {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            if (!queued_.insert(sid).second) return;
+            pending_.push_back(sid);
+        }
+        cv_.notify_one();
+    }
+};
@@ -0,0 +1,144 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Action.hpp"
+
+// Length-prefixed binary protocol used by rec_server / rec_loadgen.
+// Every frame: u32 payload length (big-endian), then the payload.
+//
+// Request payload:  u8 op, u32 seq, str user_id, then per op
+//   OP_ACTION: str track_id, u8 action, u32 ms_listened
+//   OP_TOPK:   u16 k (1..kMaxTopK)
+//   OP_NEXT:   (nothing)
+// Response payload: u8 status, u32 seq, then per op (status OK only)
+//   OP_ACTION: (nothing)
+//   OP_TOPK:   u16 n, n x str track_id
+//   OP_NEXT:   str track_id (empty if nothing to play)
+// str = u16 length + bytes. Responses come back in request order per connection.
+namespace wire {
+    enum Op : uint8_t { OP_ACTION = 1, OP_TOPK = 2, OP_NEXT = 3 };
+    enum Status : uint8_t { ST_OK = 0, ST_BAD_REQUEST = 1, ST_UNKNOWN_TRACK = 2 };
+
+    static const uint32_t kMaxFrame = 64 * 1024;
+    // Largest k a TOPK may ask for; k == 0 or k > kMaxTopK gets ST_BAD_REQUEST.
+    // 1024 ids of Spotify length (22 bytes) is ~24 KiB, well inside kMaxFrame.
+    static const uint16_t kMaxTopK = 1024;
+
+    struct Request {
+        uint8_t op = 0;
+        uint32_t seq = 0;
+        std::string user_id;
+        std::string track_id;
+        uint8_t action = 0;
+        uint32_t ms_listened = 0;
+        uint16_t k = 0;
+    };
+
+    struct Response {
+        uint8_t status = ST_OK;
+        uint32_t seq = 0;
+        std::vector<std::string> tracks; // TOPK: all, NEXT: at most one
+    };
+
+    inline void put_u8(std::string& o, uint8_t v) { o.push_back((char)v); }
+    inline void put_u16(std::string& o, uint16_t v) {
+        o.push_back((char)(v >> 8)); o.push_back((char)v);
+    }
+    inline void put_u32(std::string& o, uint32_t v) {
+        for (int sh = 24; sh >= 0; sh -= 8) o.push_back((char)(v >> sh));
+    }
+    inline void put_str(std::string& o, const std::string& s) {
+        size_t n = s.size() > 0xFFFF ? 0xFFFF : s.size();
+        put_u16(o, (uint16_t)n); o.append(s, 0, n);
+    }
+
+    inline uint32_t peek_u32(const char* p) {
+        const unsigned char* u = (const unsigned char*)p;
+        return ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) | ((uint32_t)u[2] << 8) | u[3];
+    }
+
+    // Bounds-checked cursor over one payload; any overrun flips ok to false
+    struct Reader {
+        const char* p; size_t n; size_t i = 0; bool ok = true;
+        Reader(const char* data, size_t len) : p(data), n(len) {}
+        bool need(size_t k) { if (!ok || n - i < k) ok = false; return ok; }
+        uint8_t u8() { if (!need(1)) return 0; return (uint8_t)p[i++]; }
+        uint16_t u16() {
+            if (!need(2)) return 0;
+            uint16_t v = (uint16_t)(((unsigned char)p[i] << 8) | (unsigned char)p[i+1]); i += 2; return v;
+        }
+        uint32_t u32() { if (!need(4)) return 0; uint32_t v = peek_u32(p + i); i += 4; return v; }
+        std::string str() {
+            uint16_t len = u16(); if (!need(len)) return std::string();
+            std::string s(p + i, len); i += len; return s;
+        }
+    };
+
+    // Frame = length prefix + payload
+    inline void begin_frame(std::string& o, size_t& at) { at = o.size(); put_u32(o, 0); }
+    inline void end_frame(std::string& o, size_t at) {
+        uint32_t len = (uint32_t)(o.size() - at - 4);
+        for (int b = 0; b < 4; ++b) o[at + b] = (char)(len >> (24 - 8*b));
+    }
+
+    inline void encode_request(std::string& o, const Request& r) {
+        size_t at; begin_frame(o, at);
+        put_u8(o, r.op); put_u32(o, r.seq); put_str(o, r.user_id);
+        if (r.op == OP_ACTION) { put_str(o, r.track_id); put_u8(o, r.action); put_u32(o, r.ms_listened); }
+        else if (r.op == OP_TOPK) put_u16(o, r.k);
+        end_frame(o, at);
+    }
+
+    inline bool decode_request(const char* p, size_t n, Request& r) {
+        Reader rd(p, n);
+        r.op = rd.u8(); r.seq = rd.u32(); r.user_id = rd.str();
+        if (r.op == OP_ACTION) {
+            r.track_id = rd.str(); r.action = rd.u8(); r.ms_listened = rd.u32();
+            if (r.action > (uint8_t)Action::NOT_INTERESTED) return false;
+        } else if (r.op == OP_TOPK) {
+            r.k = rd.u16();
+        } else if (r.op != OP_NEXT) {
+            return false;
+        }
+        return rd.ok && rd.i == n;
+    }
+
+    inline void encode_response(std::string& o, uint8_t op, const Response& r) {
+        size_t at; begin_frame(o, at);
+        put_u8(o, r.status); put_u32(o, r.seq);
+        if (r.status == ST_OK) {
+            if (op == OP_TOPK) {
+                // Never emit a frame the peer would reject: cut the list at kMaxFrame
+                size_t room = kMaxFrame - (1 + 4 + 2), n = 0;
+                for (; n < r.tracks.size() && n < 0xFFFF; ++n) {
+                    size_t need = 2 + std::min<size_t>(r.tracks[n].size(), 0xFFFF);
+                    if (need > room) break;
+                    room -= need;
+                }
+                put_u16(o, (uint16_t)n);
+                for (size_t i = 0; i < n; ++i) put_str(o, r.tracks[i]);
+            } else if (op == OP_NEXT) {
+                put_str(o, r.tracks.empty() ? std::string() : r.tracks[0]);
+            }
+        }
+        end_frame(o, at);
+    }
+
+    // Caller knows which op the response answers (responses are in order)
+    inline bool decode_response(const char* p, size_t n, uint8_t op, Response& r) {
+        Reader rd(p, n);
+        r.status = rd.u8(); r.seq = rd.u32(); r.tracks.clear();
+        if (rd.ok && r.status == ST_OK) {
+            if (op == OP_TOPK) {
+                uint16_t cnt = rd.u16();
+                for (uint16_t i = 0; i < cnt && rd.ok; ++i) r.tracks.push_back(rd.str());
+            } else if (op == OP_NEXT) {
+                r.tracks.push_back(rd.str());
+            }
+        }
+        return rd.ok;
+    }
+
+}
@@ -20,6 +20,12 @@ public:
 
     size_t size() const { return by_id_.size(); }
 
+    std::vector<std::string> ids() const {
+        std::vector<std::string> v; v.reserve(by_id_.size());
+        for (const auto& kv : by_id_) v.push_back(kv.first);
+        return v;
+    }
+
     // Load from CSV with the columns provided in your dataset
     size_t loadFromCSV(const std::string& path) {
         std::ifstream f(path); if (!f.is_open()) { std::cerr << "Cannot open "<<path<<"\n"; return 0; }
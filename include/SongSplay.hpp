@@ -1,33 +1,43 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <unordered_map>
 #include "Song.hpp"
 #include "UserProfile.hpp"
 #include "ml_similarity.hpp"
 
 struct Node {
     Song* song;
+    int key; // score when the song was last (re)inserted
     Node* left = nullptr;
     Node* right = nullptr;
-    explicit Node(Song* s) : song(s) {}
+    Node(Song* s, int k) : song(s), key(k) {}
 };
 
 class SongSplay {
 private:
     Node* root = nullptr;
     UserProfile* profile; // not owned
+    std::unordered_map<const Song*, Node*> nodes_; // song -> its node
 
-    Node* _insert(Node* node, Song* s);
+    int _score(const Song* s) const;
+    Node* _insert(Node* node, Node* n);
+    void _erase(Node* n);
     void _inorder(Node* node, std::vector<std::string>& v);
+    void _topK(Node* node, size_t k, std::vector<Song*>& v);
     Node* _rightRotate(Node* x);
     Node* _leftRotate(Node* x);
-    Node* _splay(Node* r, int key);
+    Node* _splay(Node* r, int key, const Song* s);
 
 public:
     explicit SongSplay(UserProfile* prof) : profile(prof) {}
 
     void insert(Song* s);
     void promote(Song* s, int delta);
+    void rescore(Song* s); // re-key after user_score was changed directly
     std::vector<std::string> inorder();
+    // Highest keys first, no splaying. Keys are refreshed whenever a song is
+    // inserted/promoted/rescored; profile drift alone does not re-key others.
+    std::vector<Song*> topK(size_t k);
 
 };
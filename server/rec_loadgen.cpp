@@ -0,0 +1,295 @@
+// =============================================================
+// File: server/rec_loadgen.cpp
+// -------------------------------------------------------------
+// Load generator for rec_server. Opens C connections, keeps P requests
+// pipelined on each, and reports throughput and p50/p99/p999 latency.
+// Sockets are non-blocking and poll()ed for both directions, so replies
+// are read while requests are still being written.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "WireProtocol.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 7070;
+    std::string unix_path;
+    int conns = 4;
+    int pipeline = 16;
+    long requests = 20000;  // per connection
+    int users = 1000;
+    int pct_action = 50, pct_topk = 25; // rest are NEXT
+    int k = 10;
+    unsigned seed = 42;
+};
+
+void usage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " [--tcp HOST:PORT | --unix PATH] [--conns C] [--pipeline P]\n"
+              << "       [--requests N] [--users U] [--mix ACTION:TOPK] [--k K<=" << wire::kMaxTopK << "] [--seed S]\n";
+}
+
+bool parse_args(int argc, char** argv, Options& o) {
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        auto val = [&]() -> std::string { return i + 1 < argc ? argv[++i] : std::string(); };
+        if (a == "--unix") o.unix_path = val();
+        else if (a == "--tcp") {
+            std::string hp = val(); auto c = hp.rfind(':');
+            if (c == std::string::npos) return false;
+            o.host = hp.substr(0, c); o.port = std::atoi(hp.c_str() + c + 1);
+        }
+        else if (a == "--conns") o.conns = std::max(1, std::atoi(val().c_str()));
+        else if (a == "--pipeline") o.pipeline = std::max(1, std::atoi(val().c_str()));
+        else if (a == "--requests") o.requests = std::max(1L, std::atol(val().c_str()));
+        else if (a == "--users") o.users = std::max(1, std::atoi(val().c_str()));
+        else if (a == "--mix") {
+            std::string m = val(); auto c = m.find(':');
+            if (c == std::string::npos) return false;
+            o.pct_action = std::atoi(m.c_str()); o.pct_topk = std::atoi(m.c_str() + c + 1);
+            if (o.pct_action < 0 || o.pct_topk < 0 || o.pct_action + o.pct_topk > 100) return false;
+        }
+        else if (a == "--k") o.k = std::clamp(std::atoi(val().c_str()), 1, (int)wire::kMaxTopK);
+        else if (a == "--seed") o.seed = (unsigned)std::strtoul(val().c_str(), nullptr, 10);
+        else return false;
+    }
+    return true;
+}
+
+int connect_to(const Options& o) {
+    int fd;
+    if (!o.unix_path.empty()) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        sockaddr_un addr{}; addr.sun_family = AF_UNIX;
+        if (o.unix_path.size() >= sizeof(addr.sun_path)) { close(fd); return -1; }
+        std::strcpy(addr.sun_path, o.unix_path.c_str());
+        if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) { close(fd); return -1; }
+    } else {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        sockaddr_in addr{}; addr.sin_family = AF_INET; addr.sin_port = htons((uint16_t)o.port);
+        if (inet_pton(AF_INET, o.host.c_str(), &addr.sin_addr) != 1) { close(fd); return -1; }
+        if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) { close(fd); return -1; }
+        int one = 1; setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+bool write_all(int fd, const std::string& b) {
+    size_t off = 0;
+    while (off < b.size()) {
+        ssize_t w = write(fd, b.data() + off, b.size() - off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        off += (size_t)w;
+    }
+    return true;
+}
+
+// Buffered frame reader over a blocking socket (bootstrap only)
+struct FrameIn {
+    int fd; std::string buf; size_t off = 0;
+    explicit FrameIn(int f) : fd(f) {}
+    // true while complete frames are buffered; otherwise reads more
+    bool next(const char*& p, uint32_t& len) {
+        for (;;) {
+            if (buf.size() - off >= 4) {
+                len = wire::peek_u32(buf.data() + off);
+                if (len > wire::kMaxFrame) return false;
+                if (buf.size() - off - 4 >= len) { p = buf.data() + off + 4; off += 4 + len; return true; }
+            }
+            buf.erase(0, off); off = 0;
+            char tmp[64 * 1024];
+            ssize_t r = read(fd, tmp, sizeof(tmp));
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) return false;
+            buf.append(tmp, (size_t)r);
+        }
+    }
+    bool buffered() const { return buf.size() - off >= 4; }
+};
+
+// Fetch a pool of valid track ids to act on
+std::vector<std::string> bootstrap_tracks(const Options& o) {
+    std::vector<std::string> out;
+    int fd = connect_to(o); if (fd < 0) return out;
+    wire::Request rq; rq.op = wire::OP_TOPK; rq.user_id = "loadgen"; rq.k = wire::kMaxTopK;
+    std::string b; wire::encode_request(b, rq);
+    FrameIn in(fd); const char* p; uint32_t len; wire::Response rs;
+    if (write_all(fd, b) && in.next(p, len) && wire::decode_response(p, len, wire::OP_TOPK, rs))
+        out = rs.tracks;
+    close(fd);
+    return out;
+}
+
+struct Result {
+    std::vector<int64_t> lat_ns;
+    long errors = 0;
+    bool failed = false;
+};
+
+// Encoded requests not yet handed to the kernel. Refilling stops here so
+// a deep --pipeline cannot turn into an unbounded client-side buffer.
+const size_t kMaxUnsent = 256 * 1024;
+
+void run_conn(const Options& o, const std::vector<std::string>& tracks, int id, Result& res) {
+    int fd = connect_to(o);
+    if (fd < 0) { res.failed = true; return; }
+    int fl = fcntl(fd, F_GETFL, 0);
+    if (fl < 0 || fcntl(fd, F_SETFL, fl | O_NONBLOCK) < 0) { res.failed = true; close(fd); return; }
+    std::mt19937_64 rng(o.seed + (unsigned)id);
+    static const Action kActions[] = {
+        Action::PLAY_COMPLETE, Action::PLAY_COMPLETE, Action::PLAY_COMPLETE, Action::SKIP_EARLY,
+        Action::SKIP_LATE, Action::LIKE, Action::REPLAY, Action::DISLIKE
+    };
+    // end = stream offset just past this request's last byte
+    struct InFlight { uint8_t op; uint32_t seq; uint64_t end; Clock::time_point t; };
+    std::deque<InFlight> inflight;
+    uint32_t seq = 0;
+    long sent = 0, done = 0;
+    size_t unstamped = 0;         // tail of `inflight` not fully written yet
+    uint64_t encoded = 0, written = 0;
+    res.lat_ns.reserve((size_t)o.requests);
+
+    std::string out; size_t out_off = 0;
+    auto enqueue = [&]() {
+        wire::Request rq; rq.seq = seq++;
+        rq.user_id = "u" + std::to_string(rng() % (uint64_t)o.users);
+        int r = (int)(rng() % 100);
+        if (r < o.pct_action) {
+            rq.op = wire::OP_ACTION;
+            rq.track_id = tracks[rng() % tracks.size()];
+            rq.action = (uint8_t)kActions[rng() % (sizeof(kActions) / sizeof(kActions[0]))];
+            rq.ms_listened = (uint32_t)(rng() % 240000);
+        } else if (r < o.pct_action + o.pct_topk) {
+            rq.op = wire::OP_TOPK; rq.k = (uint16_t)o.k;
+        } else {
+            rq.op = wire::OP_NEXT;
+        }
+        size_t before = out.size();
+        wire::encode_request(out, rq);
+        encoded += out.size() - before;
+        inflight.push_back({rq.op, rq.seq, encoded, Clock::time_point{}});
+        ++sent; ++unstamped;
+    };
+
+    // Write what the socket takes. Latency starts once a request's last
+    // byte is handed to the kernel, not when it was queued.
+    auto pump_out = [&]() -> bool {
+        while (out_off < out.size()) {
+            ssize_t w = write(fd, out.data() + out_off, out.size() - out_off);
+            if (w < 0 && errno == EINTR) continue;
+            if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (w <= 0) return false;
+            out_off += (size_t)w; written += (uint64_t)w;
+        }
+        auto now = Clock::now();
+        for (size_t i = inflight.size() - unstamped; i < inflight.size() && inflight[i].end <= written; ++i) {
+            inflight[i].t = now; --unstamped;
+        }
+        if (out_off == out.size()) { out.clear(); out_off = 0; }
+        else if (out_off > out.size() / 2) { out.erase(0, out_off); out_off = 0; }
+        return true;
+    };
+
+    // Drain replies without blocking; false on error or EOF
+    std::string in; size_t in_off = 0;
+    wire::Response rs;
+    auto pump_in = [&]() -> bool {
+        char tmp[64 * 1024];
+        for (;;) {
+            ssize_t r = read(fd, tmp, sizeof(tmp));
+            if (r > 0) { in.append(tmp, (size_t)r); continue; }
+            if (r < 0 && errno == EINTR) continue;
+            if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            return false;
+        }
+        auto now = Clock::now();
+        while (in.size() - in_off >= 4) {
+            uint32_t len = wire::peek_u32(in.data() + in_off);
+            if (len > wire::kMaxFrame || inflight.empty()) return false;
+            if (in.size() - in_off - 4 < len) break;
+            InFlight f = inflight.front(); inflight.pop_front();
+            if (!wire::decode_response(in.data() + in_off + 4, len, f.op, rs) || rs.seq != f.seq || rs.status != wire::ST_OK) ++res.errors;
+            res.lat_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(now - f.t).count());
+            ++done;
+            in_off += 4 + len;
+        }
+        in.erase(0, in_off); in_off = 0;
+        return true;
+    };
+
+    while (done < o.requests) {
+        while (sent < o.requests && (long)inflight.size() < o.pipeline && out.size() - out_off < kMaxUnsent)
+            enqueue();
+        pollfd pfd{fd, POLLIN, 0};
+        if (out_off < out.size()) pfd.events |= POLLOUT;
+        int n = poll(&pfd, 1, 10000);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) { res.failed = true; break; } // error or 10s without progress
+        if ((pfd.revents & POLLOUT) && !pump_out()) { res.failed = true; break; }
+        if ((pfd.revents & (POLLIN | POLLHUP | POLLERR)) && !pump_in()) { res.failed = true; break; }
+    }
+    close(fd);
+}
+
+double pct(const std::vector<int64_t>& v, double q) {
+    if (v.empty()) return 0.0;
+    size_t i = (size_t)(q * (double)(v.size() - 1) + 0.5);
+    return (double)v[std::min(i, v.size() - 1)] / 1000.0; // us
+}
+
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parse_args(argc, argv, opt)) { usage(argv[0]); return 2; }
+
+    auto tracks = bootstrap_tracks(opt);
+    if (tracks.empty()) { std::cerr << "could not fetch tracks from server\n"; return 1; }
+
+    std::vector<Result> results((size_t)opt.conns);
+    std::vector<std::thread> th;
+    auto t0 = Clock::now();
+    for (int i = 0; i < opt.conns; ++i)
+        th.emplace_back(run_conn, std::cref(opt), std::cref(tracks), i, std::ref(results[(size_t)i]));
+    for (auto& t : th) t.join();
+    double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+
+    std::vector<int64_t> all; long errors = 0; int failed = 0;
+    for (auto& r : results) {
+        all.insert(all.end(), r.lat_ns.begin(), r.lat_ns.end());
+        errors += r.errors; failed += r.failed ? 1 : 0;
+    }
+    std::sort(all.begin(), all.end());
+
+    std::cout << "conns=" << opt.conns << " pipeline=" << opt.pipeline
+              << " requests=" << all.size() << " errors=" << errors
+              << " failed_conns=" << failed << "\n"
+              << "elapsed_s=" << secs << " throughput_rps=" << (secs > 0 ? (double)all.size() / secs : 0.0) << "\n"
+              << "latency_us p50=" << pct(all, 0.50) << " p99=" << pct(all, 0.99)
+              << " p999=" << pct(all, 0.999) << " max=" << pct(all, 1.0) << "\n";
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,467 @@
+// =============================================================
+// File: server/rec_server.cpp
+// -------------------------------------------------------------
+// Local recommendation server: epoll event loop over TCP or a Unix
+// socket, speaking the framed protocol in WireProtocol.hpp.
+// Each loop iteration drains every readable connection and applies the
+// decoded ACTIONs through PlayerController::onActions in as few batches
+// as per-user ordering allows (one tree lock, one log flush per batch).
+// TOPK is global, so it acts as a barrier: it runs after every request
+// that came before it on its own connection.
+// A connection whose unsent output passes kOutHighWater stops being read
+// (EPOLLIN dropped) until the peer drains it.
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "PlayerController.hpp"
+#include "WireProtocol.hpp"
+
+namespace {
+
+volatile std::sig_atomic_t g_stop = 0;
+void on_signal(int) { g_stop = 1; }
+
+struct Options {
+    std::string csv = "data/spotify_songs.csv";
+    std::string host = "127.0.0.1";
+    int port = 7070;
+    std::string unix_path;   // non-empty -> listen on a Unix socket instead
+    size_t preload = 0;      // 0 = ingest the whole registry
+    int retrain_every = 0;   // 0 = never shell out to the trainer
+    size_t max_sessions = 100000;
+    int session_idle_s = 600; // prefetch sessions unused this long are dropped
+};
+
+void usage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " [--csv PATH] [--tcp HOST:PORT | --unix PATH]\n"
+              << "       [--preload K] [--retrain-every N]\n"
+              << "       [--max-sessions N] [--session-idle SECONDS]\n";
+}
+
+bool parse_args(int argc, char** argv, Options& o) {
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        auto val = [&]() -> std::string { return i + 1 < argc ? argv[++i] : std::string(); };
+        if (a == "--csv") o.csv = val();
+        else if (a == "--unix") o.unix_path = val();
+        else if (a == "--tcp") {
+            std::string hp = val(); auto c = hp.rfind(':');
+            if (c == std::string::npos) return false;
+            o.host = hp.substr(0, c); o.port = std::atoi(hp.c_str() + c + 1);
+        }
+        else if (a == "--preload") o.preload = std::strtoul(val().c_str(), nullptr, 10);
+        else if (a == "--retrain-every") o.retrain_every = std::atoi(val().c_str());
+        else if (a == "--max-sessions") o.max_sessions = std::max<size_t>(1, std::strtoul(val().c_str(), nullptr, 10));
+        else if (a == "--session-idle") o.session_idle_s = std::max(1, std::atoi(val().c_str()));
+        else return false;
+    }
+    return true;
+}
+
+bool set_nonblocking(int fd) {
+    int fl = fcntl(fd, F_GETFL, 0);
+    return fl >= 0 && fcntl(fd, F_SETFL, fl | O_NONBLOCK) == 0;
+}
+
+int open_listener(const Options& o) {
+    int fd;
+    if (!o.unix_path.empty()) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        sockaddr_un addr{}; addr.sun_family = AF_UNIX;
+        if (o.unix_path.size() >= sizeof(addr.sun_path)) { close(fd); return -1; }
+        std::strcpy(addr.sun_path, o.unix_path.c_str());
+        unlink(o.unix_path.c_str());
+        if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) { close(fd); return -1; }
+    } else {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        int one = 1; setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr{}; addr.sin_family = AF_INET; addr.sin_port = htons((uint16_t)o.port);
+        if (inet_pton(AF_INET, o.host.c_str(), &addr.sin_addr) != 1) { close(fd); return -1; }
+        if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) { close(fd); return -1; }
+    }
+    if (listen(fd, SOMAXCONN) < 0 || !set_nonblocking(fd)) { close(fd); return -1; }
+    return fd;
+}
+
+// Backpressure limits, per connection
+const size_t kOutHighWater = 1 << 20;    // stop reading above this much unsent output
+const size_t kInBufCap = 256 * 1024;     // stop read() once this much is buffered
+const size_t kFramesPerPass = 256;       // decode at most this many requests per pass
+
+struct Conn {
+    int fd = -1;
+    bool dead = false;
+    bool eof = false;               // peer closed its write side; answer, then close
+    uint32_t events = EPOLLIN;      // currently registered epoll mask
+    bool touched = false;           // already queued for this iteration's flush
+    bool backlogged = false;        // complete frames left in `in`
+    std::string in;                 // unparsed bytes
+    std::string out; size_t out_off = 0;
+    std::vector<std::string> slots; // this iteration's responses, in request order
+    size_t round = 0;               // TOPKs decoded so far this iteration
+};
+
+struct Pending {
+    Conn* c;
+    size_t slot;
+    wire::Request req;
+};
+
+// Requests of one pass between TOPK barriers. Phase l holds each user's
+// requests after its l-th NEXT: ACTIONs first (one batch), then NEXTs.
+struct Phase { std::vector<Pending> actions, nexts; };
+struct Round {
+    std::vector<Phase> phases; size_t phases_used = 0;
+    std::unordered_map<std::string, size_t> level; // user -> NEXTs seen this round
+    std::vector<Pending> topk;                     // barrier closing the round
+};
+
+class Server {
+    Options opt_;
+    PlayerController& pc_;
+    int lfd_ = -1, ep_ = -1;
+    int spare_fd_ = -1;          // held open so EMFILE can still accept-and-drop
+    bool accept_paused_ = false; // listener out of epoll until an fd frees up
+    std::unordered_map<int, std::unique_ptr<Conn>> conns_;
+    // Requests of one pass, split into rounds at each connection's TOPK.
+    // TOPK is global, so it must not overtake earlier requests from the
+    // same connection.
+    std::vector<Round> rounds_;
+    size_t rounds_used_ = 0;
+    std::vector<Conn*> touched_;
+    std::vector<Conn*> backlog_;    // conns with undecoded frames, resumed next pass
+    // counters
+    uint64_t requests_ = 0, actions_ = 0, action_batches_ = 0, topk_walks_ = 0, evicted_sessions_ = 0;
+
+public:
+    Server(const Options& o, PlayerController& pc) : opt_(o), pc_(pc) {}
+
+    ~Server() {
+        for (auto& kv : conns_) close(kv.first);
+        if (ep_ >= 0) close(ep_);
+        if (lfd_ >= 0) close(lfd_);
+        if (spare_fd_ >= 0) close(spare_fd_);
+        if (!opt_.unix_path.empty()) unlink(opt_.unix_path.c_str());
+    }
+
+    bool start() {
+        lfd_ = open_listener(opt_);
+        if (lfd_ < 0) { std::cerr << "listen failed: " << std::strerror(errno) << "\n"; return false; }
+        ep_ = epoll_create1(0);
+        if (ep_ < 0) return false;
+        spare_fd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        epoll_event ev{}; ev.events = EPOLLIN; ev.data.fd = lfd_;
+        return epoll_ctl(ep_, EPOLL_CTL_ADD, lfd_, &ev) == 0;
+    }
+
+    void run() {
+        std::vector<epoll_event> evs(256);
+        auto last_sweep = std::chrono::steady_clock::now();
+        while (!g_stop) {
+            int n = epoll_wait(ep_, evs.data(), (int)evs.size(), backlog_.empty() ? 500 : 0);
+            if (n < 0) { if (errno == EINTR) continue; std::cerr << "epoll_wait: " << std::strerror(errno) << "\n"; break; }
+            resume_backlog();
+            for (int i = 0; i < n; ++i) {
+                int fd = evs[i].data.fd;
+                if (fd == lfd_) { accept_all(); continue; }
+                auto it = conns_.find(fd); if (it == conns_.end()) continue;
+                Conn* c = it->second.get();
+                if (evs[i].events & EPOLLERR) c->dead = true;
+                if (evs[i].events & (EPOLLIN | EPOLLHUP)) read_conn(c);
+                touch(c); // flushes pending output, closes if dead
+            }
+            run_batches();
+            flush_touched();
+
+            // Session ids come off the wire, so idle ones must not pile up
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_sweep >= std::chrono::seconds(1)) {
+                evicted_sessions_ += pc_.evict_idle(std::chrono::seconds(opt_.session_idle_s));
+                resume_accept(); // fds may have been freed outside the server
+                last_sweep = now;
+            }
+        }
+    }
+
+    void report(std::ostream& os) {
+        os << "requests=" << requests_ << " action_batches=" << action_batches_
+           << " avg_action_batch=" << (action_batches_ ? (double)actions_ / (double)action_batches_ : 0.0)
+           << " topk_walks=" << topk_walks_
+           << " sessions=" << pc_.session_count() << " idle_evicted=" << evicted_sessions_ << "\n";
+    }
+
+private:
+    // Out of fds: the level-triggered listener would stay readable and spin
+    // the loop. Give up the spare fd to accept and drop the pending
+    // connection; if that is not possible either, stop polling the listener
+    // until a connection closes (or the next sweep). Returns true if one
+    // connection was dropped and more may be pending. accept() reports
+    // EMFILE even on an empty queue, so only this path can see EAGAIN.
+    bool on_fd_exhaustion() {
+        if (spare_fd_ >= 0) {
+            close(spare_fd_);
+            int fd = accept(lfd_, nullptr, nullptr);
+            int err = errno;
+            if (fd >= 0) close(fd);
+            spare_fd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            if (spare_fd_ >= 0) {
+                if (fd >= 0) return true;
+                if (err == EAGAIN || err == EWOULDBLOCK) return false;
+            }
+        }
+        if (!accept_paused_ && epoll_ctl(ep_, EPOLL_CTL_DEL, lfd_, nullptr) == 0) accept_paused_ = true;
+        return false;
+    }
+
+    void resume_accept() {
+        if (!accept_paused_) return;
+        if (spare_fd_ < 0) spare_fd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        epoll_event ev{}; ev.events = EPOLLIN; ev.data.fd = lfd_;
+        if (epoll_ctl(ep_, EPOLL_CTL_ADD, lfd_, &ev) == 0) accept_paused_ = false;
+    }
+
+    void accept_all() {
+        for (;;) {
+            int fd = accept(lfd_, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                    if (on_fd_exhaustion()) continue; // dropped one; try the next
+                }
+                return; // queue drained, or listener paused
+            }
+            if (!set_nonblocking(fd)) { close(fd); continue; }
+            if (opt_.unix_path.empty()) { int one = 1; setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); }
+            epoll_event ev{}; ev.events = EPOLLIN; ev.data.fd = fd;
+            if (epoll_ctl(ep_, EPOLL_CTL_ADD, fd, &ev) < 0) { close(fd); continue; }
+            auto c = std::make_unique<Conn>(); c->fd = fd;
+            conns_[fd] = std::move(c);
+        }
+    }
+
+    void touch(Conn* c) {
+        if (!c->touched) { c->touched = true; touched_.push_back(c); }
+    }
+
+    static size_t pending_out(const Conn* c) { return c->out.size() - c->out_off; }
+
+    static bool has_frame(const Conn* c) {
+        if (c->in.size() < 4) return false;
+        uint32_t len = wire::peek_u32(c->in.data());
+        return len > wire::kMaxFrame || c->in.size() - 4 >= len; // oversize -> decode() kills it
+    }
+
+    void resume_backlog() {
+        std::vector<Conn*> todo; todo.swap(backlog_);
+        for (Conn* c : todo) {
+            c->backlogged = false;
+            decode(c);
+            touch(c);
+        }
+    }
+
+    void read_conn(Conn* c) {
+        char buf[64 * 1024];
+        while (!c->eof && c->in.size() < kInBufCap) {
+            ssize_t r = read(c->fd, buf, sizeof(buf));
+            if (r > 0) { c->in.append(buf, (size_t)r); continue; }
+            if (r < 0 && errno == EINTR) continue;
+            if (r == 0) c->eof = true; // half-close: requests already read still get answers
+            else if (errno != EAGAIN && errno != EWOULDBLOCK) c->dead = true;
+            break;
+        }
+        decode(c);
+    }
+
+    Round& round_at(size_t r) {
+        if (rounds_.size() <= r) rounds_.resize(r + 1);
+        rounds_used_ = std::max(rounds_used_, r + 1);
+        return rounds_[r];
+    }
+
+    // Split up to kFramesPerPass complete frames into rounds and phases
+    void decode(Conn* c) {
+        size_t off = 0, frames = 0;
+        while (c->in.size() - off >= 4 && frames < kFramesPerPass) {
+            uint32_t len = wire::peek_u32(c->in.data() + off);
+            if (len > wire::kMaxFrame) { c->dead = true; break; }
+            if (c->in.size() - off - 4 < len) break;
+            Pending p{c, c->slots.size(), {}};
+            c->slots.emplace_back();
+            if (!wire::decode_request(c->in.data() + off + 4, len, p.req)) {
+                wire::Response bad; bad.status = wire::ST_BAD_REQUEST;
+                wire::encode_response(c->slots[p.slot], 0, bad);
+            } else {
+                Round& rd = round_at(c->round);
+                if (p.req.op == wire::OP_TOPK) {
+                    rd.topk.push_back(std::move(p));
+                    ++c->round;
+                } else {
+                    // Phase = NEXTs this user already has in the round, so a
+                    // user's ACTIONs and NEXTs keep their relative order
+                    size_t& lvl = rd.level[p.req.user_id];
+                    if (rd.phases.size() <= lvl) rd.phases.resize(lvl + 1);
+                    rd.phases_used = std::max(rd.phases_used, lvl + 1);
+                    if (p.req.op == wire::OP_ACTION) rd.phases[lvl].actions.push_back(std::move(p));
+                    else { rd.phases[lvl].nexts.push_back(std::move(p)); ++lvl; }
+                }
+            }
+            off += 4 + len; ++frames;
+        }
+        c->in.erase(0, off);
+    }
+
+    // Run one pass: per round, each phase applies its ACTIONs as a single
+    // PlayerController::onActions batch and then serves its NEXTs; the
+    // round's TOPKs run last, so each sees everything before it on its
+    // own connection.
+    void run_batches() {
+        Memo memo;
+        for (size_t r = 0; r < rounds_used_; ++r) {
+            Round& rd = rounds_[r];
+            for (size_t l = 0; l < rd.phases_used; ++l) {
+                Phase& ph = rd.phases[l];
+                if (!ph.actions.empty()) { execute_actions(ph.actions); memo.ok = false; }
+                for (auto& p : ph.nexts) execute(p, memo);
+                ph.actions.clear(); ph.nexts.clear();
+            }
+            for (auto& p : rd.topk) execute(p, memo);
+            rd.topk.clear(); rd.level.clear(); rd.phases_used = 0;
+        }
+        rounds_used_ = 0;
+    }
+
+    void execute_actions(std::vector<Pending>& batch) {
+        std::vector<PlayerController::ActionEvent> evs;
+        evs.reserve(batch.size());
+        for (auto& p : batch)
+            evs.push_back({p.req.user_id, p.req.track_id, (Action)p.req.action, (int)p.req.ms_listened});
+        std::vector<char> known;
+        pc_.onActions(evs, &known);
+        ++action_batches_; actions_ += batch.size(); requests_ += batch.size();
+        for (size_t i = 0; i < batch.size(); ++i) {
+            wire::Response res; res.seq = batch[i].req.seq;
+            // PlayerController skips unknown tracks, so report it here
+            if (!known[i]) res.status = wire::ST_UNKNOWN_TRACK;
+            wire::encode_response(batch[i].c->slots[batch[i].slot], wire::OP_ACTION, res);
+        }
+    }
+
+    // Consecutive TOPK queries share one tree walk until an action
+    // changes the scores.
+    struct Memo { std::vector<Song*> top; size_t k = 0; bool ok = false; };
+
+    void execute(Pending& p, Memo& memo) {
+        ++requests_;
+        wire::Response res; res.seq = p.req.seq;
+        switch (p.req.op) {
+            case wire::OP_TOPK: {
+                size_t k = p.req.k;
+                if (k == 0 || k > wire::kMaxTopK) { res.status = wire::ST_BAD_REQUEST; break; }
+                if (!memo.ok || memo.k < k) { memo.top = pc_.topK(k); memo.k = k; memo.ok = true; ++topk_walks_; }
+                for (size_t i = 0; i < k && i < memo.top.size(); ++i) res.tracks.push_back(memo.top[i]->track_id);
+                break;
+            }
+            case wire::OP_NEXT: {
+                if (Song* s = pc_.next(p.req.user_id)) res.tracks.push_back(s->track_id);
+                break;
+            }
+        }
+        wire::encode_response(p.c->slots[p.slot], p.req.op, res);
+    }
+
+    void flush_touched() {
+        for (Conn* c : touched_) {
+            c->touched = false;
+            for (auto& s : c->slots) c->out += s;
+            c->slots.clear();
+            c->round = 0;
+            while (!c->dead && c->out_off < c->out.size()) {
+                ssize_t w = write(c->fd, c->out.data() + c->out_off, c->out.size() - c->out_off);
+                if (w > 0) { c->out_off += (size_t)w; continue; }
+                if (w < 0 && errno == EINTR) continue;
+                if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+                c->dead = true;
+            }
+            if (c->out_off == c->out.size()) { c->out.clear(); c->out_off = 0; }
+            else if (c->out_off > c->out.size() / 2) { c->out.erase(0, c->out_off); c->out_off = 0; }
+            if (c->dead) continue;
+
+            // Backpressure: while the peer is not reading, neither do we
+            bool readable = pending_out(c) < kOutHighWater;
+            uint32_t want = 0;
+            if (readable && !c->eof) want |= EPOLLIN;
+            if (pending_out(c)) want |= EPOLLOUT;
+            if (want != c->events) {
+                epoll_event ev{}; ev.events = want; ev.data.fd = c->fd;
+                epoll_ctl(ep_, EPOLL_CTL_MOD, c->fd, &ev);
+                c->events = want;
+            }
+            if (readable && !c->backlogged && has_frame(c)) { c->backlogged = true; backlog_.push_back(c); }
+            // After EOF, close once every decoded request has been answered
+            if (c->eof && !pending_out(c) && !c->backlogged) c->dead = true;
+        }
+        for (Conn* c : touched_) {
+            if (!c->dead) continue;
+            if (c->backlogged) backlog_.erase(std::find(backlog_.begin(), backlog_.end(), c));
+            int fd = c->fd;
+            epoll_ctl(ep_, EPOLL_CTL_DEL, fd, nullptr);
+            close(fd);
+            conns_.erase(fd);
+            resume_accept(); // an fd is free again
+        }
+        touched_.clear();
+    }
+};
+
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parse_args(argc, argv, opt)) { usage(argv[0]); return 2; }
+
+    SongRegistry registry;
+    size_t n = registry.loadFromCSV(opt.csv);
+    if (n == 0) { std::cerr << "no songs loaded from " << opt.csv << "\n"; return 1; }
+
+    PlayerController pc(registry);
+    pc.set_retrain_batch(opt.retrain_every > 0 ? opt.retrain_every : INT_MAX);
+    pc.set_max_sessions(opt.max_sessions);
+    pc.preload_ids_ = registry.ids();
+    pc.ingest_first_k(opt.preload ? opt.preload : n);
+
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    Server srv(opt, pc);
+    if (!srv.start()) return 1;
+    std::cerr << "loaded " << n << " songs, listening on "
+              << (opt.unix_path.empty() ? opt.host + ":" + std::to_string(opt.port) : opt.unix_path)
+              << "\n";
+    srv.run();
+
+    srv.report(std::cerr);
+    std::cerr << pc.prefetch_stats() << "\n";
+    return 0;
+}
@@ -1,42 +1,87 @@
 // =============================================================
 // File: src/SongSplay.cpp
 // -------------------------------------------------------------
+#include <functional>
 #include "SongSplay.hpp"
 
+// Order by (key, song) so equal scores still give every node a unique position
+static int cmp_key(int ka, const Song* a, int kb, const Song* b) {
+    if (ka != kb) return ka < kb ? -1 : 1;
+    if (a == b) return 0;
+    return std::less<const Song*>()(a, b) ? -1 : 1;
+}
+
+int SongSplay::_score(const Song* s) const {
+    return s->finalScore(profile->getAverage(), profile->total_interactions, ml_similarity);
+}
+
 void SongSplay::insert(Song* s) {
-    root = _insert(root, s);
-    int sc = s->finalScore(profile->getAverage(), profile->total_interactions, ml_similarity);
-    root = _splay(root, sc);
+    if (nodes_.count(s)) { rescore(s); return; }
+    Node* n = new Node(s, _score(s));
+    nodes_[s] = n;
+    root = _insert(root, n);
+    root = _splay(root, n->key, s);
 }
 
 void SongSplay::promote(Song* s, int delta) {
     s->user_score += delta;
     if (delta >= 0) profile->update(s, delta); // only move centroid for positive signal
-    int sc = s->finalScore(profile->getAverage(), profile->total_interactions, ml_similarity);
-    root = _splay(root, sc);
+    rescore(s);
+}
+
+// Take the node out under its old key, then put it back under the new one,
+// so the in-order sequence follows the song's current score.
+void SongSplay::rescore(Song* s) {
+    auto it = nodes_.find(s);
+    if (it == nodes_.end()) return;
+    Node* n = it->second;
+    _erase(n);
+    n->key = _score(s); n->left = n->right = nullptr;
+    root = _insert(root, n);
+    root = _splay(root, n->key, s);
 }
 
 std::vector<std::string> SongSplay::inorder() {
     std::vector<std::string> v; _inorder(root, v); return v;
 }
 
-Node* SongSplay::_insert(Node* node, Song* s) {
-    if (!node) return new Node(s);
-    int score = s->finalScore(profile->getAverage(), profile->total_interactions, ml_similarity);
-    int rootScore = node->song->finalScore(profile->getAverage(), profile->total_interactions, ml_similarity);
-    if (score < rootScore) node->left = _insert(node->left, s);
-    else node->right = _insert(node->right, s);
+std::vector<Song*> SongSplay::topK(size_t k) {
+    std::vector<Song*> v; v.reserve(k); _topK(root, k, v); return v;
+}
+
+Node* SongSplay::_insert(Node* node, Node* n) {
+    if (!node) return n;
+    if (cmp_key(n->key, n->song, node->key, node->song) < 0) node->left = _insert(node->left, n);
+    else node->right = _insert(node->right, n);
     return node;
 }
 
+// Splay n to the root, then join its subtrees (max of left becomes new root)
+void SongSplay::_erase(Node* n) {
+    root = _splay(root, n->key, n->song);
+    if (root != n) return;
+    Node* l = n->left; Node* r = n->right;
+    if (!l) { root = r; return; }
+    l = _splay(l, n->key, n->song); // n is larger than all of l -> max rises
+    l->right = r;
+    root = l;
+}
+
 void SongSplay::_inorder(Node* node, std::vector<std::string>& v) {
     if (!node) return;
     _inorder(node->left, v);
-    int score = node->song->finalScore(profile->getAverage(), profile->total_interactions, ml_similarity);
-    v.push_back(node->song->track_name + " (score=" + std::to_string(score) + ")");
+    v.push_back(node->song->track_name + " (score=" + std::to_string(node->key) + ")");
     _inorder(node->right, v);
 }
 
+// reverse inorder walk: right subtree holds the higher keys
+void SongSplay::_topK(Node* node, size_t k, std::vector<Song*>& v) {
+    if (!node || v.size() >= k) return;
+    _topK(node->right, k, v);
+    if (v.size() < k) v.push_back(node->song);
+    _topK(node->left, k, v);
+}
+
 Node* SongSplay::_rightRotate(Node* x) {
     Node* y = x->left; x->left = y->right; y->right = x; return y;
 }
@@ -44,29 +89,29 @@ Node* SongSplay::_leftRotate(Node* x) {
     Node* y = x->right; x->right = y->left; y->left = x; return y;
 }
 
-Node* SongSplay::_splay(Node* r, int key) {
+Node* SongSplay::_splay(Node* r, int key, const Song* s) {
     if (!r) return r;
-    int rScore = r->song->finalScore(profile->getAverage(), profile->total_interactions, ml_similarity);
+    int c = cmp_key(key, s, r->key, r->song);
 
-    if (key < rScore) {
+    if (c < 0) {
         if (!r->left) return r;
-        int lScore = r->left->song->finalScore(profile->getAverage(), profile->total_interactions, ml_similarity);
-        if (key < lScore) {
-            r->left->left = _splay(r->left->left, key);
+        int cl = cmp_key(key, s, r->left->key, r->left->song);
+        if (cl < 0) {
+            r->left->left = _splay(r->left->left, key, s);
             r = _rightRotate(r);
-        } else if (key > lScore) {
-            r->left->right = _splay(r->left->right, key);
+        } else if (cl > 0) {
+            r->left->right = _splay(r->left->right, key, s);
             if (r->left->right) r->left = _leftRotate(r->left);
         }
         return (!r->left) ? r : _rightRotate(r);
-    } else if (key > rScore) {
+    } else if (c > 0) {
         if (!r->right) return r;
-        int rrScore = r->right->song->finalScore(profile->getAverage(), profile->total_interactions, ml_similarity);
-        if (key > rrScore) {
-            r->right->right = _splay(r->right->right, key);
+        int cr = cmp_key(key, s, r->right->key, r->right->song);
+        if (cr > 0) {
+            r->right->right = _splay(r->right->right, key, s);
             r = _leftRotate(r);
-        } else if (key < rrScore) {
-            r->right->left = _splay(r->right->left, key);
+        } else if (cr < 0) {
+            r->right->left = _splay(r->right->left, key, s);
             if (r->right->left) r->right = _rightRotate(r->right);
         }
         return (!r->right) ? r : _leftRotate(r);